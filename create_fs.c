@@ -0,0 +1,224 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include "fs-sim.h"
+
+#define DISK_BLOCKS 128
+#define DISK_SIZE (DISK_BLOCKS * 1024)
+
+// Options for prepopulating an image
+typedef struct {
+    int dirs;          // Number of directories to create
+    int files;         // Number of files to create
+    int max_blocks;    // Largest file size in blocks
+    int fragmentation; // Percentage of free space left as holes between files
+    char *pattern;     // zero, index or random
+    uint64_t seed;     // Seed for every random choice, so images are reproducible
+    int preallocate;   // Allocate every block instead of leaving the image sparse
+} Options;
+
+static char image[DISK_SIZE]; // Whole image, built in memory and written out in one pass
+static uint64_t rng_state;
+
+// splitmix64
+uint64_t next_random(void) {
+    uint64_t z = (rng_state += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+// Returns a number in [0, limit)
+int random_below(int limit) {
+    return (int)(next_random() % (uint64_t)limit);
+}
+
+void setBitInRange(char *free_block_list, int start, int end, int value) {
+    for (int i = start; i <= end; i++) {
+        if (value) {
+            free_block_list[i / 8] |= (1 << (7 - (i % 8))); // Set bit
+        } else {
+            free_block_list[i / 8] &= ~(1 << (7 - (i % 8))); // Clear bit
+        }
+    }
+}
+
+// Fills one data block of a file according to the chosen pattern
+void fill_block(char *block, const char *pattern, const char *name, int block_num) {
+    if (strcmp(pattern, "index") == 0) {
+        // Same layout as a B command: text followed by zeros
+        snprintf(block, 1024, "%.5s block %d", name, block_num);
+    } else if (strcmp(pattern, "random") == 0) {
+        for (int i = 0; i < 1024; i += 8) {
+            uint64_t value = next_random();
+            memcpy(block + i, &value, 8);
+        }
+    }
+}
+
+// Lays out a deterministic tree of directories and files in the in-memory image.
+// Returns 0, or -1 if it does not fit on the disk.
+int populate(Superblock *superblock, Options *options) {
+    if (options->dirs + options->files > 126) {
+        fprintf(stderr, "Error: %d directories and %d files need more than 126 inodes\n",
+                options->dirs, options->files);
+        return -1;
+    }
+
+    // Directories hang off the root or an earlier directory
+    int inode_index = 0;
+    for (int i = 0; i < options->dirs; i++) {
+        Inode *inode = &superblock->inode[inode_index];
+        int parent = random_below(i + 1);
+        char name[16];
+        snprintf(name, sizeof(name), "d%d", i); // At most 4 characters, since i < 126
+        memcpy(inode->name, name, strlen(name));
+        inode->used_size = 0x80;
+        inode->dir_parent = 0x80 | (parent == i ? 127 : parent);
+        inode_index++;
+    }
+
+    // Pick every file size up front so the free space can be split into holes
+    int sizes[126];
+    int used_blocks = 0;
+    for (int i = 0; i < options->files; i++) {
+        sizes[i] = 1 + random_below(options->max_blocks);
+        used_blocks += sizes[i];
+    }
+    if (used_blocks > DISK_BLOCKS - 1) {
+        fprintf(stderr, "Error: Files need %d blocks, only %d are available\n", used_blocks, DISK_BLOCKS - 1);
+        return -1;
+    }
+
+    // Spread the requested share of free blocks as holes in front of the files
+    int holes = (DISK_BLOCKS - 1 - used_blocks) * options->fragmentation / 100;
+    int gaps[126] = {0};
+    for (int i = 0; i < holes && options->files > 0; i++) gaps[random_below(options->files)]++;
+
+    int block = 1;
+    for (int i = 0; i < options->files; i++) {
+        Inode *inode = &superblock->inode[inode_index];
+        char name[16];
+        snprintf(name, sizeof(name), "f%d", i); // At most 4 characters, since i < 126
+        memcpy(inode->name, name, strlen(name));
+
+        block += gaps[i];
+        inode->start_block = block;
+        inode->used_size = 0x80 | sizes[i];
+        inode->dir_parent = options->dirs ? random_below(options->dirs + 1) : 127;
+        if (inode->dir_parent == options->dirs) inode->dir_parent = 127; // The root
+
+        setBitInRange(superblock->free_block_list, block, block + sizes[i] - 1, 1);
+        for (int j = 0; j < sizes[i]; j++) {
+            fill_block(image + (block + j) * 1024, options->pattern, name, j);
+        }
+        block += sizes[i];
+        inode_index++;
+    }
+    return 0;
+}
+
+// Removes the checksum table and snapshot sidecars fs keeps next to disk_name, since they
+// describe the image being replaced
+void remove_sidecars(const char *disk_name) {
+    const char *suffixes[] = { ".crc", ".snap" };
+    for (int i = 0; i < 2; i++) {
+        char path[256];
+        snprintf(path, sizeof(path), "%s%s", disk_name, suffixes[i]);
+        unlink(path);
+    }
+}
+
+// Writes the image to disk_name. Runs of all-zero blocks are skipped over so the file stays
+// sparse unless preallocation was asked for; the rest goes out in large sequential writes.
+int write_image(const char *disk_name, int preallocate) {
+    int fd = open(disk_name, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        perror(disk_name);
+        return -1;
+    }
+
+    if (ftruncate(fd, DISK_SIZE) != 0 ||
+        (preallocate && posix_fallocate(fd, 0, DISK_SIZE) != 0)) {
+        perror(disk_name);
+        close(fd);
+        return -1;
+    }
+
+    static const char zero_block[1024];
+    int block = 0;
+    while (block < DISK_BLOCKS) {
+        if (memcmp(image + block * 1024, zero_block, 1024) == 0) {
+            block++;
+            continue;
+        }
+        int run_start = block;
+        while (block < DISK_BLOCKS && memcmp(image + block * 1024, zero_block, 1024) != 0) block++;
+
+        size_t length = (size_t)(block - run_start) * 1024;
+        if (pwrite(fd, image + run_start * 1024, length, run_start * 1024) != (ssize_t)length) {
+            perror(disk_name);
+            close(fd);
+            return -1;
+        }
+    }
+
+    close(fd);
+    return 0;
+}
+
+void usage(char *program) {
+    fprintf(stderr, "Usage: %s [-d dirs] [-f files] [-b max_blocks] [-F fragmentation%%] "
+                    "[-p zero|index|random] [-s seed] [-a] <disk_name>...\n", program);
+}
+
+int main(int argc, char *argv[]) {
+    Options options = { 0, 0, 1, 0, "zero", 1, 0 };
+
+    int option;
+    while ((option = getopt(argc, argv, "d:f:b:F:p:s:a")) != -1) {
+        switch (option) {
+            case 'd': options.dirs = atoi(optarg); break;
+            case 'f': options.files = atoi(optarg); break;
+            case 'b': options.max_blocks = atoi(optarg); break;
+            case 'F': options.fragmentation = atoi(optarg); break;
+            case 'p': options.pattern = optarg; break;
+            case 's': options.seed = strtoull(optarg, NULL, 10); break;
+            case 'a': options.preallocate = 1; break;
+            default:
+                usage(argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+
+    if (optind == argc || options.dirs < 0 || options.files < 0 || options.max_blocks < 1 ||
+        options.max_blocks > DISK_BLOCKS - 1 || options.fragmentation < 0 || options.fragmentation > 100 ||
+        (strcmp(options.pattern, "zero") != 0 && strcmp(options.pattern, "index") != 0 &&
+         strcmp(options.pattern, "random") != 0)) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    for (int i = optind; i < argc; i++) {
+        // Every disk named on the command line gets an identical image
+        printf("Creating disk %s\n", argv[i]);
+        memset(image, 0, sizeof(image));
+        rng_state = options.seed;
+
+        Superblock *superblock = (Superblock *)image;
+        setBitInRange(superblock->free_block_list, 0, 0, 1); // Block 0 holds the superblock
+        if (populate(superblock, &options) != 0) return EXIT_FAILURE;
+
+        // Only once the new image is known to fit, so a failed run leaves the old disk intact
+        remove_sidecars(argv[i]);
+        if (write_image(argv[i], options.preallocate) != 0) return EXIT_FAILURE;
+        printf("Disk %s is created.\n", argv[i]);
+    }
+
+    printf("Done.\n");
+
+    return EXIT_SUCCESS;
+}
@@ -11,12 +11,15 @@ typedef struct {
 } Superblock;
 
 void fs_mount(char *new_disk_name);
-void fs_create(char name[5], int size);
-void fs_delete(char name[5]);
-void fs_read(char name[5], int block_num);
-void fs_write(char name[5], int block_num);
+void fs_create(char *path, int size);
+void fs_delete(char *path);
+void fs_read(char *name, int block_num);
+void fs_write(char *name, int block_num);
 void fs_buff(char buff[1024]);
 void fs_ls(void);
-void fs_resize(char name[5], int new_size);
+void fs_resize(char *name, int new_size);
 void fs_defrag(void);
-void fs_cd(char name[5]);
\ No newline at end of file
+void fs_cd(char *name);
+void fs_snapshot(void);
+void fs_rollback(void);
+void fs_scrub(void);
\ No newline at end of file
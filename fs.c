@@ -7,11 +7,20 @@
 #include <ctype.h>
 #include <libgen.h>
 #include <string.h>
+#include <sys/stat.h>
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#endif
 
 static Superblock superblock; // In-memory superblock
 static char buffer[1024];     // File system buffer
 static int current_working_dir = 127; // Start at root (special case)
 static FILE *disk_file = NULL; // Pointer to the virtual disk
+static int dedup_enabled = 0; // Skip writes of contents a block already holds (-d)
+static int checksums_enabled = 0; // Create <disk>.crc at mount if it is missing (-c)
 
 char *returnBinary(char *free_block_list) {
     char *binary_map = malloc(129); // 128 blocks + null terminator
@@ -32,6 +41,646 @@ void setBitInRange(char *free_block_list, int start, int end, int value) {
     }
 }
 
+// Struct-of-arrays mirror of superblock.inode, padded to 128 entries so scans run in whole
+// vectors. Bytes in inode_used/inode_dir are 0xFF or 0x00 so they can be used directly as masks.
+static uint8_t inode_used[128];
+static uint8_t inode_dir[128];
+static uint8_t inode_parent[128];
+static uint8_t inode_size[128];
+static uint8_t inode_start[128];
+static uint64_t free_inode_map[2]; // Bit i set when inode i is free (never set for 126 and 127)
+
+// Copies inode i of the superblock into the mirror; call after every change to that inode
+void inode_mirror_update(int i) {
+    Inode *inode = &superblock.inode[i];
+    inode_used[i] = (inode->used_size & 0x80) ? 0xFF : 0x00;
+    inode_dir[i] = (inode->dir_parent & 0x80) ? 0xFF : 0x00;
+    inode_parent[i] = inode->dir_parent & 0x7F;
+    inode_size[i] = inode->used_size & 0x7F;
+    inode_start[i] = inode->start_block;
+
+    if (inode_used[i]) {
+        free_inode_map[i / 64] &= ~(1ULL << (i % 64));
+    } else {
+        free_inode_map[i / 64] |= 1ULL << (i % 64);
+    }
+}
+
+// Rebuilds the whole mirror from the superblock
+void inode_mirror_load(void) {
+    memset(inode_used, 0, sizeof(inode_used));
+    memset(inode_dir, 0, sizeof(inode_dir));
+    memset(inode_parent, 0, sizeof(inode_parent));
+    memset(inode_size, 0, sizeof(inode_size));
+    memset(inode_start, 0, sizeof(inode_start));
+    free_inode_map[0] = free_inode_map[1] = 0;
+    for (int i = 0; i < 126; i++) inode_mirror_update(i);
+}
+
+// Returns the lowest free inode, or -1 if the table is full
+int find_free_inode(void) {
+    for (int word = 0; word < 2; word++) {
+        if (free_inode_map[word]) return word * 64 + __builtin_ctzll(free_inode_map[word]);
+    }
+    return -1;
+}
+
+// Sets bit i of mask[] for every in-use inode whose parent is dir
+void children_mask(int dir, uint64_t mask[2]) {
+    mask[0] = mask[1] = 0;
+#if defined(__AVX2__)
+    __m256i key = _mm256_set1_epi8((char)dir);
+    for (int i = 0; i < 128; i += 32) {
+        __m256i parent = _mm256_loadu_si256((const __m256i *)&inode_parent[i]);
+        __m256i used = _mm256_loadu_si256((const __m256i *)&inode_used[i]);
+        __m256i hit = _mm256_and_si256(_mm256_cmpeq_epi8(parent, key), used);
+        mask[i / 64] |= (uint64_t)(uint32_t)_mm256_movemask_epi8(hit) << (i % 64);
+    }
+#elif defined(__SSE2__)
+    __m128i key = _mm_set1_epi8((char)dir);
+    for (int i = 0; i < 128; i += 16) {
+        __m128i parent = _mm_loadu_si128((const __m128i *)&inode_parent[i]);
+        __m128i used = _mm_loadu_si128((const __m128i *)&inode_used[i]);
+        __m128i hit = _mm_and_si128(_mm_cmpeq_epi8(parent, key), used);
+        mask[i / 64] |= (uint64_t)_mm_movemask_epi8(hit) << (i % 64);
+    }
+#else
+    for (int i = 0; i < 126; i++) {
+        if (inode_used[i] && inode_parent[i] == dir) mask[i / 64] |= 1ULL << (i % 64);
+    }
+#endif
+}
+
+// Returns the file inode whose blocks contain block, or -1 if the block is unowned.
+// A block b belongs to inode i when (uint8_t)(b - start) < size; directories and free
+// inodes have size 0 and never match.
+int block_owner(int block) {
+#if defined(__AVX2__)
+    __m256i key = _mm256_set1_epi8((char)block);
+    for (int i = 0; i < 128; i += 32) {
+        __m256i start = _mm256_loadu_si256((const __m256i *)&inode_start[i]);
+        __m256i size = _mm256_loadu_si256((const __m256i *)&inode_size[i]);
+        __m256i offset = _mm256_sub_epi8(key, start);
+        __m256i outside = _mm256_cmpeq_epi8(_mm256_max_epu8(offset, size), offset); // offset >= size
+        uint32_t hits = ~(uint32_t)_mm256_movemask_epi8(outside);
+        if (hits) return i + __builtin_ctz(hits);
+    }
+#elif defined(__SSE2__)
+    __m128i key = _mm_set1_epi8((char)block);
+    for (int i = 0; i < 128; i += 16) {
+        __m128i start = _mm_loadu_si128((const __m128i *)&inode_start[i]);
+        __m128i size = _mm_loadu_si128((const __m128i *)&inode_size[i]);
+        __m128i offset = _mm_sub_epi8(key, start);
+        __m128i outside = _mm_cmpeq_epi8(_mm_max_epu8(offset, size), offset); // offset >= size
+        uint32_t hits = ~(uint32_t)_mm_movemask_epi8(outside) & 0xFFFF;
+        if (hits) return i + __builtin_ctz(hits);
+    }
+#else
+    for (int i = 0; i < 126; i++) {
+        if ((uint8_t)(block - inode_start[i]) < inode_size[i]) return i;
+    }
+#endif
+    return -1;
+}
+
+// Dentry cache: every in-use inode is chained into a bucket keyed by (parent inode, name),
+// so each path component resolves without scanning the inode table
+#define DENTRY_BUCKETS 128
+static int dentry_bucket[DENTRY_BUCKETS]; // First inode in each chain, -1 if empty
+static int dentry_next[126];              // Next inode in the same chain, -1 at the end
+
+unsigned int dentry_hash(int parent, const char *name) {
+    unsigned int hash = 2166136261u ^ (unsigned int)parent;
+    for (int i = 0; i < 5 && name[i] != '\0'; i++) {
+        hash = (hash ^ (unsigned char)name[i]) * 16777619u;
+    }
+    return hash % DENTRY_BUCKETS;
+}
+
+void dentry_insert(int inode_index) {
+    Inode *inode = &superblock.inode[inode_index];
+    unsigned int bucket = dentry_hash(inode->dir_parent & 0x7F, inode->name);
+    dentry_next[inode_index] = dentry_bucket[bucket];
+    dentry_bucket[bucket] = inode_index;
+}
+
+// Must be called before the inode is cleared, while its key is still intact
+void dentry_remove(int inode_index) {
+    Inode *inode = &superblock.inode[inode_index];
+    int *link = &dentry_bucket[dentry_hash(inode->dir_parent & 0x7F, inode->name)];
+    while (*link != -1) {
+        if (*link == inode_index) {
+            *link = dentry_next[inode_index];
+            return;
+        }
+        link = &dentry_next[*link];
+    }
+}
+
+// Rebuilds the cache from the in-memory superblock
+void dentry_cache_build(void) {
+    for (int i = 0; i < DENTRY_BUCKETS; i++) dentry_bucket[i] = -1;
+    for (int i = 125; i >= 0; i--) {
+        if (superblock.inode[i].used_size & 0x80) dentry_insert(i);
+    }
+}
+
+// Returns the inode named name inside directory parent, or -1 if there is none
+int lookup_child(int parent, const char *name) {
+    for (int i = dentry_bucket[dentry_hash(parent, name)]; i != -1; i = dentry_next[i]) {
+        Inode *inode = &superblock.inode[i];
+        if ((inode->dir_parent & 0x7F) == parent && strncmp(inode->name, name, 5) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// Checks that every component of a slash-separated path is at most 5 characters long
+int valid_path(const char *path) {
+    int length = 0;
+    for (; *path; path++) {
+        if (*path == '/') {
+            length = 0;
+        } else if (++length > 5) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// Moves from directory dir to the directory named component; returns -1 if there is none.
+// The root (127) is its own parent.
+int step_into(int dir, const char *component) {
+    if (strcmp(component, ".") == 0) return dir;
+    if (strcmp(component, "..") == 0) {
+        return dir == 127 ? 127 : superblock.inode[dir].dir_parent & 0x7F;
+    }
+    int child = lookup_child(dir, component);
+    if (child == -1 || !(superblock.inode[child].dir_parent & 0x80)) return -1;
+    return child;
+}
+
+// Splits an absolute or relative path into the directory holding its last component
+// and the component itself (empty for "/"). Returns 0, or -1 if a directory on the way is missing.
+int resolve_parent(const char *path, int *parent, char leaf[6]) {
+    int dir = (path[0] == '/') ? 127 : current_working_dir;
+    leaf[0] = '\0';
+
+    while (*path) {
+        while (*path == '/') path++;
+        if (*path == '\0') break;
+
+        // Copy out the next component
+        char component[6];
+        int length = 0;
+        while (*path && *path != '/') {
+            if (length == 5) return -1;
+            component[length++] = *path++;
+        }
+        component[length] = '\0';
+
+        // Only descend once we know this is not the last component
+        if (leaf[0] != '\0') {
+            dir = step_into(dir, leaf);
+            if (dir == -1) return -1;
+        }
+        strcpy(leaf, component);
+    }
+
+    *parent = dir;
+    return 0;
+}
+
+// Returns the inode a path refers to (127 for the root), or -1 if it does not exist
+int resolve_path(const char *path) {
+    int parent;
+    char leaf[6];
+    if (resolve_parent(path, &parent, leaf) == -1) return -1;
+    if (leaf[0] == '\0') return parent;
+    if (strcmp(leaf, ".") == 0 || strcmp(leaf, "..") == 0) return step_into(parent, leaf);
+    return lookup_child(parent, leaf);
+}
+
+// Hashes a 1 KB block with four 64-bit lanes. Each 32-byte stripe is mixed as in xxh3's
+// accumulate step: the two 32-bit halves of (data ^ key) are multiplied into the lane and
+// the raw data is added to the neighbouring lane. All three paths give the same result.
+uint64_t block_hash(const char *data) {
+    static const uint64_t keys[4] = {
+        0x9E3779B185EBCA87ULL, 0xC2B2AE3D27D4EB4FULL, 0x165667B19E3779F9ULL, 0x85EBCA77C2B2AE63ULL
+    };
+    uint64_t lanes[4] = { 1024, 0, 0, 0 };
+
+#if defined(__AVX2__)
+    __m256i acc = _mm256_loadu_si256((const __m256i *)lanes);
+    __m256i key = _mm256_loadu_si256((const __m256i *)keys);
+    for (int i = 0; i < 1024; i += 32) {
+        __m256i d = _mm256_loadu_si256((const __m256i *)(data + i));
+        __m256i dk = _mm256_xor_si256(d, key);
+        __m256i product = _mm256_mul_epu32(dk, _mm256_shuffle_epi32(dk, _MM_SHUFFLE(0, 3, 0, 1)));
+        acc = _mm256_add_epi64(acc, _mm256_shuffle_epi32(d, _MM_SHUFFLE(1, 0, 3, 2)));
+        acc = _mm256_add_epi64(acc, product);
+    }
+    _mm256_storeu_si256((__m256i *)lanes, acc);
+#elif defined(__SSE2__)
+    __m128i acc[2], key[2];
+    for (int j = 0; j < 2; j++) {
+        acc[j] = _mm_loadu_si128((const __m128i *)&lanes[2 * j]);
+        key[j] = _mm_loadu_si128((const __m128i *)&keys[2 * j]);
+    }
+    for (int i = 0; i < 1024; i += 32) {
+        for (int j = 0; j < 2; j++) {
+            __m128i d = _mm_loadu_si128((const __m128i *)(data + i + 16 * j));
+            __m128i dk = _mm_xor_si128(d, key[j]);
+            __m128i product = _mm_mul_epu32(dk, _mm_shuffle_epi32(dk, _MM_SHUFFLE(0, 3, 0, 1)));
+            acc[j] = _mm_add_epi64(acc[j], _mm_shuffle_epi32(d, _MM_SHUFFLE(1, 0, 3, 2)));
+            acc[j] = _mm_add_epi64(acc[j], product);
+        }
+    }
+    for (int j = 0; j < 2; j++) _mm_storeu_si128((__m128i *)&lanes[2 * j], acc[j]);
+#else
+    for (int i = 0; i < 1024; i += 32) {
+        uint64_t d[4];
+        memcpy(d, data + i, sizeof(d));
+        for (int l = 0; l < 4; l++) {
+            uint64_t dk = d[l] ^ keys[l];
+            lanes[l] += d[l ^ 1] + (dk & 0xFFFFFFFFULL) * (dk >> 32);
+        }
+    }
+#endif
+
+    // Fold the lanes and finish with murmur3's avalanche
+    uint64_t hash = lanes[0] ^ (lanes[1] * 0x9E3779B185EBCA87ULL) ^
+                    (lanes[2] * 0xC2B2AE3D27D4EB4FULL) ^ (lanes[3] * 0x165667B19E3779F9ULL);
+    hash ^= hash >> 33;
+    hash *= 0xFF51AFD7ED558CCDULL;
+    hash ^= hash >> 33;
+    hash *= 0xC4CEB9FE1A85EC53ULL;
+    hash ^= hash >> 33;
+    return hash;
+}
+
+// Dedup state: the hash and a copy of the contents each data block is known to hold.
+// Files are contiguous runs, so blocks cannot be shared between files on disk; instead a
+// write or zero-fill is skipped when the target block already holds the same content.
+static int block_known[128];           // 1 when block_hashes/block_cache are valid
+static uint64_t block_hashes[128];
+static char block_cache[128][1024];
+static uint64_t buffer_hash; // Hash of buffer, computed once per B command
+static const char zero_block[1024];
+static uint64_t zero_hash;
+
+void dedup_reset(void) {
+    memset(block_known, 0, sizeof(block_known));
+    zero_hash = block_hash(zero_block);
+}
+
+// Records that block now holds data
+void dedup_track(int block, const char *data, uint64_t hash) {
+    block_known[block] = 1;
+    block_hashes[block] = hash;
+    memcpy(block_cache[block], data, 1024);
+}
+
+// Returns 1 if block is known to already hold data
+int dedup_holds(int block, const char *data, uint64_t hash) {
+    return block_known[block] && block_hashes[block] == hash &&
+           memcmp(block_cache[block], data, 1024) == 0;
+}
+
+// Records that count blocks were copied from from_block to to_block and the source blocks
+// outside the destination were zeroed, as fs_resize and fs_defrag do when moving a file
+void dedup_move(int from_block, int to_block, int count) {
+    memmove(&block_known[to_block], &block_known[from_block], count * sizeof(block_known[0]));
+    memmove(&block_hashes[to_block], &block_hashes[from_block], count * sizeof(block_hashes[0]));
+    memmove(block_cache[to_block], block_cache[from_block], count * sizeof(block_cache[0]));
+    for (int block = from_block; block < from_block + count; block++) {
+        if (block < to_block || block >= to_block + count) dedup_track(block, zero_block, zero_hash);
+    }
+}
+
+// Indexes every data block of the mounted disk with one sequential read
+void dedup_load(void) {
+    dedup_reset();
+
+    fseek(disk_file, 1024, SEEK_SET);
+    if (fread(block_cache[1], 1024, 127, disk_file) == 127) {
+        for (int block = 1; block < 128; block++) {
+            block_known[block] = 1;
+            block_hashes[block] = block_hash(block_cache[block]);
+        }
+    }
+}
+
+// Snapshot of the mounted disk, kept in the <disk>.snap sidecar so it outlives the process.
+// Identifies the mounted image as it is on disk right now. Sidecar files are stamped with it
+// after every write fs makes, so a later write by anything else (create_fs, a copy of another
+// image, an editor) shows up as a mismatch.
+typedef struct {
+    uint64_t device;
+    uint64_t inode;
+    int64_t size;
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+} ImageIdentity;
+
+ImageIdentity image_identity(void) {
+    ImageIdentity identity;
+    struct stat info;
+    memset(&identity, 0, sizeof(identity));
+    fflush(disk_file);
+    if (fstat(fileno(disk_file), &info) == 0) {
+        identity.device = info.st_dev;
+        identity.inode = info.st_ino;
+        identity.size = info.st_size;
+        identity.mtime_sec = info.st_mtim.tv_sec;
+        identity.mtime_nsec = info.st_mtim.tv_nsec;
+    }
+    return identity;
+}
+
+// The sidecar mirrors the image layout: the saved superblock sits in block 0, each preserved
+// block at its own offset, and a trailer after block 127 holds the current directory and the
+// shared bitmap, stamped with the image's identity. Taking a snapshot marks every data block as shared with it; the first time
+// a shared block is about to be modified, its current contents are copied into the sidecar
+// and the block stops being shared.
+#define SNAPSHOT_MAGIC "FSSNAP1"
+typedef struct {
+    char magic[8];
+    int32_t working_dir;
+    char shared[16];   // Bit per block, same layout as free_block_list
+    ImageIdentity image; // The image as of the last write since the snapshot was taken
+} SnapshotTrailer;
+
+static int snapshot_taken = 0;
+static Superblock snapshot_superblock;
+static SnapshotTrailer snapshot_trailer;
+static FILE *snapshot_file = NULL;
+static char snapshot_path[256];
+static char snapshot_run[127][1024]; // Staging for runs of blocks moving in or out of the sidecar
+
+int snapshot_is_shared(int block) {
+    return (snapshot_trailer.shared[block / 8] & (1 << (7 - (block % 8)))) != 0;
+}
+
+void snapshot_save_trailer(void) {
+    snapshot_trailer.image = image_identity();
+    fseek(snapshot_file, 128 * 1024, SEEK_SET);
+    if (fwrite(&snapshot_trailer, sizeof(snapshot_trailer), 1, snapshot_file) != 1) {
+        fprintf(stderr, "Error: Failed to write snapshot %s.\n", snapshot_path);
+    }
+    fflush(snapshot_file);
+}
+
+// Picks up the snapshot of disk_name left by an earlier run, if there is one. A snapshot whose
+// stamp no longer matches the image cannot be rolled back to safely, so it is removed.
+void snapshot_open(const char *disk_name) {
+    if (snapshot_file) fclose(snapshot_file);
+    snapshot_taken = 0;
+    snprintf(snapshot_path, sizeof(snapshot_path), "%s.snap", disk_name);
+
+    snapshot_file = fopen(snapshot_path, "rb+");
+    if (!snapshot_file) return;
+    if (fread(&snapshot_superblock, sizeof(Superblock), 1, snapshot_file) != 1 ||
+        fseek(snapshot_file, 128 * 1024, SEEK_SET) != 0 ||
+        fread(&snapshot_trailer, sizeof(snapshot_trailer), 1, snapshot_file) != 1 ||
+        memcmp(snapshot_trailer.magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC)) != 0) {
+        return;
+    }
+
+    ImageIdentity current = image_identity();
+    if (memcmp(&snapshot_trailer.image, &current, sizeof(current)) != 0) {
+        fprintf(stderr, "Warning: Snapshot %s does not match disk %s, dropping it\n", snapshot_path, disk_name);
+        fclose(snapshot_file);
+        snapshot_file = NULL;
+        remove(snapshot_path);
+        return;
+    }
+    snapshot_taken = 1;
+}
+
+// Copies any still-shared blocks in [start, start + count) aside before they are overwritten,
+// moving each run of shared blocks with a single read and write
+void snapshot_preserve(int start, int count) {
+    if (!snapshot_taken) return;
+
+    int preserved = 0;
+    int block = start;
+    while (block < start + count) {
+        if (!snapshot_is_shared(block)) {
+            block++;
+            continue;
+        }
+        int run_start = block;
+        while (block < start + count && snapshot_is_shared(block)) block++;
+        size_t run_length = block - run_start;
+
+        fseek(disk_file, run_start * 1024, SEEK_SET);
+        fseek(snapshot_file, run_start * 1024, SEEK_SET);
+        if (fread(snapshot_run, 1024, run_length, disk_file) != run_length ||
+            fwrite(snapshot_run, 1024, run_length, snapshot_file) != run_length) {
+            fprintf(stderr, "Error: Failed to save block %d for snapshot.\n", run_start);
+        }
+        setBitInRange(snapshot_trailer.shared, run_start, block - 1, 0);
+        preserved = 1;
+    }
+
+    // The saved blocks must be on record before the caller overwrites them
+    if (preserved) snapshot_save_trailer();
+}
+
+// CRC32C (Castagnoli), reflected polynomial 0x82F63B78
+static uint32_t crc32c_table[256];
+
+uint32_t crc32c_software(const char *data, size_t length) {
+    if (crc32c_table[1] == 0) {
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t crc = i;
+            for (int bit = 0; bit < 8; bit++) crc = (crc >> 1) ^ (0x82F63B78 & -(crc & 1));
+            crc32c_table[i] = crc;
+        }
+    }
+
+    uint32_t crc = 0xFFFFFFFF;
+    for (size_t i = 0; i < length; i++) {
+        crc = crc32c_table[(crc ^ (uint8_t)data[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+#if defined(__x86_64__)
+// Uses the SSE4.2 crc32 instruction, 8 bytes at a time
+__attribute__((target("sse4.2")))
+uint32_t crc32c_hardware(const char *data, size_t length) {
+    uint64_t crc = 0xFFFFFFFF;
+    size_t i = 0;
+    for (; i + 8 <= length; i += 8) {
+        uint64_t word;
+        memcpy(&word, data + i, 8);
+        crc = _mm_crc32_u64(crc, word);
+    }
+    for (; i < length; i++) crc = _mm_crc32_u8((uint32_t)crc, (uint8_t)data[i]);
+    return ~(uint32_t)crc;
+}
+#endif
+
+uint32_t crc32c(const char *data, size_t length) {
+#if defined(__x86_64__)
+    static int has_sse42 = -1;
+    if (has_sse42 == -1) has_sse42 = __builtin_cpu_supports("sse4.2");
+    if (has_sse42) return crc32c_hardware(data, length);
+#endif
+    return crc32c_software(data, length);
+}
+
+// Checksum of every data block of the mounted disk, mirrored in the <disk>.crc sidecar file.
+// The sidecar starts with a header stamping the image as it was after the last write fs made
+// to it. If the image has been written since by anything else (a copy, an editor), its
+// identity no longer matches and the table is refused. Corruption at rest leaves the
+// modification time alone, so it shows up as a checksum mismatch instead.
+#define CHECKSUM_MAGIC "FSCRC1"
+typedef struct {
+    char magic[8];
+    ImageIdentity image;
+} ChecksumHeader;
+
+static uint32_t block_crc[128];
+static FILE *checksum_file = NULL;
+
+ChecksumHeader checksum_identity(void) {
+    ChecksumHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, CHECKSUM_MAGIC, sizeof(CHECKSUM_MAGIC));
+    header.image = image_identity();
+    return header;
+}
+
+// Writes the checksum table back to the sidecar file, stamped with the image's identity
+void checksum_save(void) {
+    if (!checksum_file) return;
+    ChecksumHeader header = checksum_identity();
+    fseek(checksum_file, 0, SEEK_SET);
+    if (fwrite(&header, sizeof(header), 1, checksum_file) != 1 ||
+        fwrite(block_crc, sizeof(block_crc), 1, checksum_file) != 1) {
+        fprintf(stderr, "Error: Failed to write checksum table.\n");
+    }
+    fflush(checksum_file);
+}
+
+// Opens the sidecar for disk_name whenever there is one, so it stays current even in runs
+// without -c. A missing table is built from the current contents only when -c was given.
+// A table written for a different version of the image is left untouched: rebuilding it
+// would bless whatever the image holds now, so it has to be removed by hand first.
+void checksum_load(const char *disk_name) {
+    if (checksum_file) fclose(checksum_file);
+
+    char path[256];
+    snprintf(path, sizeof(path), "%s.crc", disk_name);
+    checksum_file = fopen(path, "rb+");
+    if (checksum_file) {
+        ChecksumHeader header, current = checksum_identity();
+        if (fread(&header, sizeof(header), 1, checksum_file) == 1 &&
+            fread(block_crc, sizeof(block_crc), 1, checksum_file) == 1 &&
+            memcmp(&header, &current, sizeof(header)) == 0) {
+            return;
+        }
+        fprintf(stderr, "Error: Checksum table %s does not match disk %s, remove it to rebuild it\n",
+                path, disk_name);
+        fclose(checksum_file);
+        checksum_file = NULL;
+        return;
+    }
+    if (!checksums_enabled) return;
+
+    // No table yet: checksum the whole image with one sequential read
+    checksum_file = fopen(path, "wb+");
+    if (!checksum_file) {
+        fprintf(stderr, "Error: Cannot create checksum table %s\n", path);
+        return;
+    }
+
+    char *blocks = malloc(127 * 1024);
+    memset(block_crc, 0, sizeof(block_crc));
+    fseek(disk_file, 1024, SEEK_SET);
+    if (fread(blocks, 1024, 127, disk_file) == 127) {
+        for (int block = 1; block < 128; block++) {
+            block_crc[block] = crc32c(blocks + (block - 1) * 1024, 1024);
+        }
+    }
+    free(blocks);
+    checksum_save();
+}
+
+// Records the checksums of count blocks copied from from_block to to_block, with the source
+// blocks outside the destination zeroed afterwards
+void checksum_move(int from_block, int to_block, int count) {
+    uint32_t moved[127];
+    uint32_t zero_crc = crc32c(zero_block, 1024);
+    memcpy(moved, &block_crc[from_block], count * sizeof(uint32_t));
+    for (int i = 0; i < count; i++) block_crc[from_block + i] = zero_crc;
+    memcpy(&block_crc[to_block], moved, count * sizeof(uint32_t));
+}
+
+// Re-stamps the sidecars after a write to the image, so they keep matching it.
+// Call after every write to the image.
+void image_written(void) {
+    checksum_save();
+    if (snapshot_taken) snapshot_save_trailer();
+}
+
+// Read-ahead for fs_read. Files are contiguous on disk, so once a file is being read block by
+// block its next window of blocks is fetched with a single read into a staging buffer. The
+// window starts at READAHEAD_MIN blocks and doubles on every sequential miss.
+#define READAHEAD_MIN 4
+#define READAHEAD_MAX 64
+static char readahead_data[READAHEAD_MAX][1024];
+static int readahead_start = 0;        // First disk block held in readahead_data
+static int readahead_count = 0;        // Number of blocks held, 0 when empty
+static int readahead_last[126];        // Last block of each file read, -1 before the first
+static int readahead_window[126];      // Current window size of each file
+
+void readahead_reset(int inode_index) {
+    readahead_last[inode_index] = -1;
+    readahead_window[inode_index] = READAHEAD_MIN / 2;
+}
+
+// Drops the staged blocks if any of [start, start + count) is about to change on disk
+void readahead_invalidate(int start, int count) {
+    if (start < readahead_start + readahead_count && readahead_start < start + count) {
+        readahead_count = 0;
+    }
+}
+
+// Returns block block_num of the file at inode_index (which starts at start_block and has
+// size blocks), reading ahead when the file is read sequentially. NULL if the read fails.
+const char *readahead_fetch(int inode_index, int start_block, int size, int block_num) {
+    int disk_block = start_block + block_num;
+    int sequential = (block_num == readahead_last[inode_index] + 1);
+    readahead_last[inode_index] = block_num;
+
+    if (disk_block >= readahead_start && disk_block < readahead_start + readahead_count) {
+        return readahead_data[disk_block - readahead_start];
+    }
+
+    // Miss: grow the window for sequential scans, read just the one block otherwise
+    int count = 1;
+    if (sequential) {
+        readahead_window[inode_index] *= 2;
+        if (readahead_window[inode_index] > READAHEAD_MAX) readahead_window[inode_index] = READAHEAD_MAX;
+        count = readahead_window[inode_index];
+        if (count > size - block_num) count = size - block_num;
+    } else {
+        readahead_window[inode_index] = READAHEAD_MIN / 2;
+    }
+
+    readahead_count = 0;
+    fseek(disk_file, disk_block * 1024, SEEK_SET);
+    if (fread(readahead_data, 1024, count, disk_file) != (size_t)count) return NULL;
+    readahead_start = disk_block;
+    readahead_count = count;
+    return readahead_data[0];
+}
+
 void fs_mount(char *new_disk_name) {
     FILE *disk_file_temp = fopen(new_disk_name, "rb+");
     if (!disk_file_temp) {
@@ -111,7 +760,7 @@ void fs_mount(char *new_disk_name) {
         if (inode1->used_size & 0x80) { // In-use inode
             for (int j = i + 1; j < 126; j++) {
                 Inode *inode2 = &temp_superblock.inode[j];
-                if (inode2->used_size & 0x80 && inode1->dir_parent == inode2->dir_parent &&
+                if (inode2->used_size & 0x80 && (inode1->dir_parent & 0x7F) == (inode2->dir_parent & 0x7F) &&
                     strncmp(inode1->name, inode2->name, 5) == 0) {
                     fprintf(stderr, "Error: File system in %s is inconsistent (error code: 5)\n", new_disk_name);
                     fclose(disk_file_temp);
@@ -150,52 +799,60 @@ void fs_mount(char *new_disk_name) {
     disk_file = disk_file_temp;
     superblock = temp_superblock;
     current_working_dir = 127; // Root directory
+    snapshot_open(new_disk_name);
+    readahead_count = 0;
+    for (int i = 0; i < 126; i++) readahead_reset(i);
+    inode_mirror_load();
+    dentry_cache_build();
+    if (dedup_enabled) dedup_load();
+    checksum_load(new_disk_name);
 }
 
-void fs_create(char name[5], int size) {
+void fs_create(char *path, int size) {
     // Check if filesystem is mounted
     if (!disk_file) {
         fprintf(stderr, "Error: No file system is mounted\n");
         return;
     }
 
-    // Find a free inode
-    int free_inode_index = -1;
-    for (int i = 0; i < 126; i++) {
-        if ((superblock.inode[i].used_size & 0x80) == 0) { // MSB not set means free
-            free_inode_index = i;
-            break;
-        }
+    // Find the directory the new entry goes into
+    int parent;
+    char name[6];
+    if (resolve_parent(path, &parent, name) == -1) {
+        fprintf(stderr, "Error: Directory for '%s' does not exist\n", path);
+        return;
     }
+
+    // Find a free inode
+    int free_inode_index = find_free_inode();
     if (free_inode_index == -1) {
         fprintf(stderr, "Error: No free inode available to create '%.*s'.\n", 5, name);
         return;
     }
 
     // Validate name and check for duplicates in the current directory
-    if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0) {
-        fprintf(stderr, "Error: File or directory '%s' already exists\n", name);
+    if (name[0] == '\0' || strcmp(name, ".") == 0 || strcmp(name, "..") == 0) {
+        fprintf(stderr, "Error: File or directory '%s' already exists\n", path);
         return;
     }
 
-    for (int i = 0; i < 126; i++) {
-        Inode *inode = &superblock.inode[i];
-        if ((inode->used_size & 0x80) && inode->dir_parent == current_working_dir &&
-            strncmp(inode->name, name, 5) == 0) {
-            fprintf(stderr, "Error: File or directory '%.*s' already exists.\n", 5, name);
-            return;
-        }
+    if (lookup_child(parent, name) != -1) {
+        fprintf(stderr, "Error: File or directory '%.*s' already exists.\n", 5, name);
+        return;
     }
 
     Inode *new_inode = &superblock.inode[free_inode_index];
     memset(new_inode, 0, sizeof(Inode));
-    strncpy(new_inode->name, name, 5);
+    memcpy(new_inode->name, name, strlen(name));
 
     // If creating a directory
     if (size == 0) {
         // Set MSB of used_size to indicate in-use, size=0 means directory
         new_inode->used_size = 0x80;
-        new_inode->dir_parent = current_working_dir;
+        // Set MSB of dir_parent to mark the inode as a directory
+        new_inode->dir_parent = 0x80 | parent;
+        inode_mirror_update(free_inode_index);
+        dentry_insert(free_inode_index);
 
         // Write the updated superblock to disk
         fseek(disk_file, 0, SEEK_SET);
@@ -203,6 +860,7 @@ void fs_create(char name[5], int size) {
             perror("fwrite failed");
         }
         fflush(disk_file);
+        image_written();
         return;
     }
 
@@ -240,9 +898,12 @@ void fs_create(char name[5], int size) {
 
     // Initialize the inode for the file
     new_inode->start_block = first;
-    new_inode->dir_parent = current_working_dir;
+    new_inode->dir_parent = parent;
     // Set MSB of used_size to indicate in-use, and the lower 7 bits to file size
     new_inode->used_size = 0x80 | (size & 0x7F);
+    inode_mirror_update(free_inode_index);
+    readahead_reset(free_inode_index);
+    dentry_insert(free_inode_index);
 
     // Save changes to disk
     fseek(disk_file, 0, SEEK_SET);
@@ -250,58 +911,134 @@ void fs_create(char name[5], int size) {
         perror("fwrite failed");
     }
     fflush(disk_file);
+    image_written();
 }
 
-void fs_delete(char name[5]) {
-    if (!disk_file) {
-        fprintf(stderr, "Error: No file system is mounted\n");
-        return;
-    }
+// Links every in-use inode under its parent in a single pass over the inode table.
+// first_child is indexed by parent inode (127 is the root), next_sibling by inode.
+void build_child_index(int first_child[128], int next_sibling[126]) {
+    for (int i = 0; i < 128; i++) first_child[i] = -1;
 
-    // Locate the inode for the file in the current directory
-    for (int i = 0; i < 126; i++) {
+    // Walk backwards so each sibling list comes out in inode order
+    for (int i = 125; i >= 0; i--) {
         Inode *inode = &superblock.inode[i];
-        if ((inode->used_size & 0x80) && inode->dir_parent == current_working_dir) {
-            if (memcmp(inode->name, name, 5) == 0) {
-                // File found, proceed with deletion
-                int start_block = inode->start_block;
-                int size = inode->used_size & 0x7F; // Get size in blocks
-
-                // Overwrite data in the blocks
-                char empty_block[1024] = {0}; // Empty block data
-                for (int j = 0; j < size; j++) {
-                    int block_to_clear = start_block + j;
-
-                    // Overwrite block data with zeros
-                    fseek(disk_file, block_to_clear * 1024, SEEK_SET);
-                    fwrite(empty_block, 1, 1024, disk_file);
+        next_sibling[i] = -1;
+        if (inode->used_size & 0x80) {
+            int parent = inode->dir_parent & 0x7F;
+            next_sibling[i] = first_child[parent];
+            first_child[parent] = i;
+        }
+    }
+}
 
-                    // Mark block as free
-                    superblock.free_block_list[block_to_clear / 8] &=
-                        ~(1 << (7 - (block_to_clear % 8)));
-                }
+// Overwrites every block marked in zero_map with zeros, one write per run of adjacent blocks
+void zero_block_runs(const char zero_map[128]) {
+    static const char empty_blocks[127 * 1024]; // Largest possible run of data blocks
 
-                // Clear the inode
-                memset(inode, 0, sizeof(Inode));
+    if (checksum_file) {
+        uint32_t zero_crc = crc32c(zero_block, 1024);
+        for (int i = 1; i < 128; i++) {
+            if (zero_map[i]) block_crc[i] = zero_crc;
+        }
+    }
 
-                // Save updated superblock to disk
-                fseek(disk_file, 0, SEEK_SET);
-                if (fwrite(&superblock, sizeof(Superblock), 1, disk_file) != 1) {
-                    perror("fwrite failed");
-                }
-                fflush(disk_file);
+    int block = 1;
+    while (block < 128) {
+        if (!zero_map[block]) {
+            block++;
+            continue;
+        }
+        // Blocks already known to be zero need no write
+        if (dedup_enabled && dedup_holds(block, zero_block, zero_hash)) {
+            block++;
+            continue;
+        }
+        int run_start = block;
+        while (block < 128 && zero_map[block] &&
+               !(dedup_enabled && dedup_holds(block, zero_block, zero_hash))) {
+            if (dedup_enabled) dedup_track(block, zero_block, zero_hash);
+            block++;
+        }
 
-                return;
+        snapshot_preserve(run_start, block - run_start);
+        readahead_invalidate(run_start, block - run_start);
+        fseek(disk_file, run_start * 1024, SEEK_SET);
+        fwrite(empty_blocks, 1024, block - run_start, disk_file);
+    }
+}
+
+// Deletes the inode at root_index and, if it is a directory, everything beneath it.
+// The superblock is written back once after the whole subtree has been released.
+void delete_subtree(int root_index) {
+    int first_child[128];
+    int next_sibling[126];
+    build_child_index(first_child, next_sibling);
+
+    int stack[126];
+    int top = 0;
+    char zero_map[128] = {0}; // Blocks to overwrite with zeros
+
+    stack[top++] = root_index;
+    while (top > 0) {
+        int index = stack[--top];
+        Inode *inode = &superblock.inode[index];
+        int size = inode->used_size & 0x7F;
+
+        if (inode->dir_parent & 0x80) {
+            // Directory: queue all of its children
+            for (int child = first_child[index]; child != -1; child = next_sibling[child]) {
+                stack[top++] = child;
             }
+        } else if (size > 0) {
+            // File: release its contiguous run with a single range update
+            int start_block = inode->start_block;
+            setBitInRange(superblock.free_block_list, start_block, start_block + size - 1, 0);
+            memset(&zero_map[start_block], 1, size);
+        }
+
+        // Clear the inode
+        dentry_remove(index);
+        memset(inode, 0, sizeof(Inode));
+        inode_mirror_update(index);
+    }
+
+    zero_block_runs(zero_map);
+
+    // Save updated superblock to disk
+    fseek(disk_file, 0, SEEK_SET);
+    if (fwrite(&superblock, sizeof(Superblock), 1, disk_file) != 1) {
+        perror("fwrite failed");
+    }
+    fflush(disk_file);
+    image_written();
+}
+
+void fs_delete(char *path) {
+    if (!disk_file) {
+        fprintf(stderr, "Error: No file system is mounted\n");
+        return;
+    }
+
+    int target = resolve_path(path);
+    if (target == -1 || target == 127) {
+        fprintf(stderr, "Error: File or directory '%s' does not exist\n", path);
+        return;
+    }
+
+    // Refuse to remove a directory we are currently inside of
+    for (int dir = current_working_dir; dir != 127; dir = superblock.inode[dir].dir_parent & 0x7F) {
+        if (dir == target) {
+            fprintf(stderr, "Error: Cannot delete '%s' while it contains the current directory\n", path);
+            return;
         }
     }
 
-    // If no matching file is found, print an error
-    fprintf(stderr, "Error: File or directory '%.*s' does not exist\n", 5, name);
+    // Remove it along with any children
+    delete_subtree(target);
 }
 
 
-void fs_read(char name[5], int block_num) {
+void fs_read(char *name, int block_num) {
     // Check if a file system is mounted
     if (!disk_file) {
         fprintf(stderr, "Error: No file system is mounted\n");
@@ -310,12 +1047,9 @@ void fs_read(char name[5], int block_num) {
 
     // Locate the inode for the specified file
     Inode *target_inode = NULL;
-    for (int i = 0; i < 126; i++) {
-        Inode *inode = &superblock.inode[i];
-        if ((inode->used_size & 0x80) && strncmp(inode->name, name, 5) == 0) {
-            target_inode = inode;
-            break;
-        }
+    int index = resolve_path(name);
+    if (index != -1 && index != 127 && !(superblock.inode[index].dir_parent & 0x80)) {
+        target_inode = &superblock.inode[index];
     }
 
     if (!target_inode) {
@@ -325,7 +1059,7 @@ void fs_read(char name[5], int block_num) {
 
     // Validate block number
     int file_size = target_inode->used_size & 0x7F; // Extract size from used_size
-    if (block_num >= file_size) {
+    if (block_num < 0 || block_num >= file_size) {
         fprintf(stderr, "Error: Block number %d exceeds file size (%d blocks).\n", block_num, file_size);
         return;
     }
@@ -334,66 +1068,71 @@ void fs_read(char name[5], int block_num) {
     int start_block = target_inode->start_block;
     int disk_block = start_block + block_num;
 
-    // Read data from the specified block
-    char block_data[1024] = {0};
-    fseek(disk_file, disk_block * 1024, SEEK_SET);
-    if (fread(block_data, 1024, 1, disk_file) != 1) {
+    // Read data from the specified block, through the read-ahead window
+    const char *block_data = readahead_fetch(index, start_block, file_size, block_num);
+    if (!block_data) {
         fprintf(stderr, "Error: Failed to read block %d of file %s.\n", block_num, name);
         return;
     }
+
+    if (checksum_file && crc32c(block_data, 1024) != block_crc[disk_block]) {
+        fprintf(stderr, "Error: Checksum mismatch in block %d of file %s\n", block_num, name);
+    }
 }
 
-void fs_write(char name[5], int block_num) {
+void fs_write(char *name, int block_num) {
     if (!disk_file) {
         fprintf(stderr, "Error: No file system is mounted\n");
         return;
     }
 
     Inode *target_inode = NULL;
-    for (int i = 0; i < 126; i++) {
-        Inode *inode = &superblock.inode[i];
-        if ((inode->used_size & 0x80) && memcmp(inode->name, name, 5) == 0) {
-            target_inode = inode;
-            break;
-        }
+    int index = resolve_path(name);
+    if (index != -1 && index != 127 && !(superblock.inode[index].dir_parent & 0x80)) {
+        target_inode = &superblock.inode[index];
     }
 
     if (!target_inode) {
-        fprintf(stderr, "Error: File '%.*s' not found.\n", 5, name);
+        fprintf(stderr, "Error: File '%s' not found.\n", name);
         return;
     }
 
     int file_size = target_inode->used_size & 0x7F;
-    if (block_num >= file_size) {
+    if (block_num < 0 || block_num >= file_size) {
         fprintf(stderr, "Error: Block number %d exceeds file size (%d blocks).\n", block_num, file_size);
         return;
     }
 
     int disk_block = target_inode->start_block + block_num;
 
+    // The block already holds these contents, nothing to write
+    if (dedup_enabled && dedup_holds(disk_block, buffer, buffer_hash)) return;
+
+    snapshot_preserve(disk_block, 1);
+    readahead_invalidate(disk_block, 1);
     fseek(disk_file, disk_block * 1024, SEEK_SET);
     if (fwrite(buffer, 1024, 1, disk_file) != 1) {
         fprintf(stderr, "Error: Failed to write to block %d.\n", block_num);
     }
     fflush(disk_file);
+
+    if (dedup_enabled) dedup_track(disk_block, buffer, buffer_hash);
+    if (checksum_file) block_crc[disk_block] = crc32c(buffer, 1024);
+    image_written();
 }
 
 void fs_buff(char buff[1024]) {
     memset(buffer, 0, 1024);
     memcpy(buffer, buff, 1024);
+    if (dedup_enabled) buffer_hash = block_hash(buffer);
 }
 
 int calculate_directory_size(int dir_inode) {
-        int entry_count = 2; // Start with 2 for '.' and '..'
+        uint64_t children[2];
+        children_mask(dir_inode, children);
 
-        for (int i = 0; i < 126; i++) {
-            Inode *inode = &superblock.inode[i];
-            if ((inode->used_size & 0x80) && inode->dir_parent == dir_inode) {
-                entry_count++; // Count each valid entry
-            }
-        }
-
-        return entry_count;
+        // 2 for '.' and '..' plus each valid entry
+        return 2 + __builtin_popcountll(children[0]) + __builtin_popcountll(children[1]);
 }
 
 void fs_ls(void) {
@@ -410,15 +1149,17 @@ void fs_ls(void) {
     if (current_working_dir == 127) { // Root directory special case
         printf("..      %d\n", current_dir_size);
     } else {
-        int parent_dir_inode = superblock.inode[current_working_dir].dir_parent;
+        int parent_dir_inode = superblock.inode[current_working_dir].dir_parent & 0x7F;
         int parent_dir_size = calculate_directory_size(parent_dir_inode);
         printf("..      %d\n", parent_dir_size);
     }
 
     // List all entries in the current directory
+    uint64_t children[2];
+    children_mask(current_working_dir, children);
     for (int i = 0; i < 126; i++) {
         Inode *inode = &superblock.inode[i];
-        if ((inode->used_size & 0x80) && inode->dir_parent == current_working_dir) {
+        if (children[i / 64] & (1ULL << (i % 64))) {
             int entry_size = inode->used_size & 0x7F; // Extract size in blocks
             if (entry_size > 0) {
                 printf("%-5.5s %3d KB\n", inode->name, entry_size);
@@ -431,26 +1172,23 @@ void fs_ls(void) {
 }
 
 
-void fs_resize(char name[5], int new_size) {
+void fs_resize(char *name, int new_size) {
     // Ensure a file system is mounted
     if (!disk_file) {
         fprintf(stderr, "Error: No file system is mounted\n");
         return;
     }
 
-    // Locate the inode for the file in the current directory
+    // Locate the inode for the file
     Inode *target_inode = NULL;
-    for (int i = 0; i < 126; i++) {
-        Inode *inode = &superblock.inode[i];
-        if ((inode->used_size & 0x80) && memcmp(inode->name, name, 5) == 0 && inode->dir_parent == current_working_dir) {
-            target_inode = inode;
-            break;
-        }
+    int index = resolve_path(name);
+    if (index != -1 && index != 127) {
+        target_inode = &superblock.inode[index];
     }
 
     // Handle file not found or is a directory
     if (!target_inode || (target_inode->used_size & 0x7F) == 0) {
-        fprintf(stderr, "Error: File %.*s does not exist\n", 5, name);
+        fprintf(stderr, "Error: File %s does not exist\n", name);
         return;
     }
 
@@ -461,6 +1199,13 @@ void fs_resize(char name[5], int new_size) {
         // Shrink the file: Free and zero out unused blocks
         for (int i = start_block + new_size; i < start_block + current_size; i++) {
             superblock.free_block_list[i / 8] &= ~(1 << (7 - (i % 8))); // Mark block as free
+            if (checksum_file) block_crc[i] = crc32c(zero_block, 1024);
+            if (dedup_enabled) {
+                if (dedup_holds(i, zero_block, zero_hash)) continue; // Already zero
+                dedup_track(i, zero_block, zero_hash);
+            }
+            snapshot_preserve(i, 1);
+            readahead_invalidate(i, 1);
             char empty_block[1024] = {0};
             fseek(disk_file, i * 1024, SEEK_SET);
             fwrite(empty_block, 1, 1024, disk_file); // Zero out block
@@ -507,6 +1252,10 @@ void fs_resize(char name[5], int new_size) {
 
             if (free_blocks_found == new_size) {
                 // Move file to new location
+                snapshot_preserve(start_block, current_size);
+                snapshot_preserve(new_start_block, current_size);
+                readahead_invalidate(start_block, current_size);
+                readahead_invalidate(new_start_block, current_size);
                 char temp_block[1024];
                 for (int i = 0; i < current_size; i++) {
                     fseek(disk_file, (start_block + i) * 1024, SEEK_SET);
@@ -523,6 +1272,8 @@ void fs_resize(char name[5], int new_size) {
                     fseek(disk_file, i * 1024, SEEK_SET);
                     fwrite(empty_block, 1, 1024, disk_file);
                 }
+                if (dedup_enabled) dedup_move(start_block, new_start_block, current_size);
+                if (checksum_file) checksum_move(start_block, new_start_block, current_size);
 
                 // Mark new blocks as used
                 for (int i = 0; i < new_size; i++) {
@@ -534,16 +1285,19 @@ void fs_resize(char name[5], int new_size) {
                 target_inode->used_size = (target_inode->used_size & 0x80) | new_size;
             } else {
                 // Not enough contiguous free space
-                fprintf(stderr, "Error: File %.*s cannot expand to size %d\n", 5, name, new_size);
+                fprintf(stderr, "Error: File %s cannot expand to size %d\n", name, new_size);
                 return;
             }
         }
     }
 
+    inode_mirror_update(index);
+
     // Save updated superblock to disk
     fseek(disk_file, 0, SEEK_SET);
     fwrite(&superblock, sizeof(Superblock), 1, disk_file);
     fflush(disk_file);
+    image_written();
 }
 
 void fs_defrag(void) {
@@ -558,15 +1312,8 @@ void fs_defrag(void) {
 
     while (first < 128) { // Iterate through all blocks (except reserved block 0)
         if (strInBinary[first] == '1') { // If the block is in use
-            int inode_index = -1;
-
             // Find the inode corresponding to this block
-            for (int x = 0; x < 126; x++) {
-                if (superblock.inode[x].start_block == first) {
-                    inode_index = x;
-                    break;
-                }
-            }
+            int inode_index = block_owner(first);
 
             if (inode_index == -1) {
                 fprintf(stderr, "Error: Inconsistent state. No inode found for block %d.\n", first);
@@ -576,11 +1323,19 @@ void fs_defrag(void) {
 
             int used_size = superblock.inode[inode_index].used_size & 0x7F; // Extract size of file
 
+            if (first == next_start) {
+                // Already in place, nothing to move
+                next_start += used_size;
+                first += used_size;
+                continue;
+            }
+
             // Clear the old block range in the free block list
             setBitInRange(superblock.free_block_list, first, first + used_size - 1, 0);
 
             // Update inode to point to the new start block
             superblock.inode[inode_index].start_block = next_start;
+            inode_mirror_update(inode_index);
 
             // Mark the new range as used
             setBitInRange(superblock.free_block_list, next_start, next_start + used_size - 1, 1);
@@ -590,6 +1345,11 @@ void fs_defrag(void) {
             uint8_t freed[1024 * used_size];
             memset(freed, 0, sizeof(freed)); // Initialize freed block buffer
 
+            snapshot_preserve(first, used_size);
+            snapshot_preserve(next_start, used_size);
+            readahead_invalidate(first, used_size);
+            readahead_invalidate(next_start, used_size);
+
             // Read data from the old location
             fseek(disk_file, first * 1024, SEEK_SET);
             if (fread(hold_copy, sizeof(hold_copy), 1, disk_file) != 1) {
@@ -600,6 +1360,9 @@ void fs_defrag(void) {
             fseek(disk_file, first * 1024, SEEK_SET);
             fwrite(freed, sizeof(freed), 1, disk_file);
 
+            if (dedup_enabled) dedup_move(first, next_start, used_size);
+            if (checksum_file) checksum_move(first, next_start, used_size);
+
             // Write data to the new location
             fseek(disk_file, next_start * 1024, SEEK_SET);
             fwrite(hold_copy, sizeof(hold_copy), 1, disk_file);
@@ -620,9 +1383,10 @@ void fs_defrag(void) {
         fprintf(stderr, "Error: Failed to write updated superblock to disk.\n");
     }
     fflush(disk_file);
+    image_written();
 }
 
-void fs_cd(char name[5]) {
+void fs_cd(char *name) {
     // Handle special cases for "." and ".."
     if (strcmp(name, ".") == 0) {
         return; // Stay in the current directory
@@ -634,32 +1398,132 @@ void fs_cd(char name[5]) {
             return;
         }
         // Move to the parent directory
-        current_working_dir = superblock.inode[current_working_dir].dir_parent;
+        current_working_dir = superblock.inode[current_working_dir].dir_parent & 0x7F;
         return;
     }
 
-    // Search for the specified directory in the current working directory
-    for (int i = 0; i < 126; i++) {
-        Inode *inode = &superblock.inode[i];
+    // Resolve the path relative to the current working directory (or the root)
+    int index = resolve_path(name);
+    if (index == -1) {
+        fprintf(stderr, "Error: Directory '%s' does not exist\n", name);
+        return;
+    }
 
-        // Check if the inode is used, belongs to the current directory, and matches the name
-        if ((inode->used_size & 0x80) && inode->dir_parent == current_working_dir &&
-            strncmp(inode->name, name, 5) == 0) {
+    // Ensure it's a directory
+    if (index != 127 && !(superblock.inode[index].dir_parent & 0x80)) {
+        fprintf(stderr, "Error: %s is not a directory.\n", name);
+        return;
+    }
 
-            // Ensure it's a directory (size == 0 for directories)
-            if ((inode->used_size & 0x7F) == 0) {
-                current_working_dir = i; // Change to the specified directory
-                return;
-            } else {
-                // The entry exists but is not a directory
-                fprintf(stderr, "Error: %.*s is not a directory.\n", 5, name);
-                return;
-            }
+    current_working_dir = index; // Change to the specified directory
+}
+
+void fs_snapshot(void) {
+    if (!disk_file) {
+        fprintf(stderr, "Error: No file system is mounted\n");
+        return;
+    }
+
+    if (!snapshot_file) snapshot_file = fopen(snapshot_path, "wb+");
+    if (!snapshot_file) {
+        fprintf(stderr, "Error: Cannot create snapshot %s\n", snapshot_path);
+        return;
+    }
+
+    // Capture the metadata and share every data block with the snapshot
+    snapshot_superblock = superblock;
+    memset(&snapshot_trailer, 0, sizeof(snapshot_trailer));
+    memcpy(snapshot_trailer.magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+    snapshot_trailer.working_dir = current_working_dir;
+    setBitInRange(snapshot_trailer.shared, 1, 127, 1);
+
+    fseek(snapshot_file, 0, SEEK_SET);
+    if (fwrite(&snapshot_superblock, sizeof(Superblock), 1, snapshot_file) != 1) {
+        fprintf(stderr, "Error: Failed to write snapshot %s.\n", snapshot_path);
+    }
+    snapshot_save_trailer();
+    snapshot_taken = 1;
+}
+
+void fs_rollback(void) {
+    if (!disk_file) {
+        fprintf(stderr, "Error: No file system is mounted\n");
+        return;
+    }
+    if (!snapshot_taken) {
+        fprintf(stderr, "Error: No snapshot to roll back to\n");
+        return;
+    }
+
+    // Put back the blocks that were modified since the snapshot, one read and write per run
+    int block = 1;
+    while (block < 128) {
+        if (snapshot_is_shared(block)) {
+            block++;
+            continue;
+        }
+        int run_start = block;
+        while (block < 128 && !snapshot_is_shared(block)) block++;
+        size_t run_length = block - run_start;
+
+        fseek(snapshot_file, run_start * 1024, SEEK_SET);
+        if (fread(snapshot_run, 1024, run_length, snapshot_file) != run_length) {
+            fprintf(stderr, "Error: Failed to read block %d from snapshot.\n", run_start);
+            return;
+        }
+        fseek(disk_file, run_start * 1024, SEEK_SET);
+        fwrite(snapshot_run, 1024, run_length, disk_file);
+
+        for (int i = 0; i < (int)run_length; i++) {
+            if (dedup_enabled) dedup_track(run_start + i, snapshot_run[i], block_hash(snapshot_run[i]));
+            if (checksum_file) block_crc[run_start + i] = crc32c(snapshot_run[i], 1024);
         }
     }
 
-    // If no matching directory is found
-    fprintf(stderr, "Error: Directory '%.*s' does not exist\n", 5, name);
+    readahead_count = 0;
+
+    // Restore the metadata
+    superblock = snapshot_superblock;
+    current_working_dir = snapshot_trailer.working_dir;
+    inode_mirror_load();
+    dentry_cache_build();
+
+    fseek(disk_file, 0, SEEK_SET);
+    if (fwrite(&superblock, sizeof(Superblock), 1, disk_file) != 1) {
+        perror("fwrite failed");
+    }
+    fflush(disk_file);
+    image_written();
+
+    // The snapshot stays in place so it can be rolled back to again, in this run or a later one
+    setBitInRange(snapshot_trailer.shared, 1, 127, 1);
+    snapshot_save_trailer();
+}
+
+void fs_scrub(void) {
+    if (!disk_file) {
+        fprintf(stderr, "Error: No file system is mounted\n");
+        return;
+    }
+    if (!checksum_file) {
+        fprintf(stderr, "Error: Disk has no checksum table\n");
+        return;
+    }
+
+    // Stream the whole data area in one read and verify every block
+    char *blocks = malloc(127 * 1024);
+    fseek(disk_file, 1024, SEEK_SET);
+    if (fread(blocks, 1024, 127, disk_file) != 127) {
+        fprintf(stderr, "Error: Failed to read disk for scrub.\n");
+        free(blocks);
+        return;
+    }
+    for (int block = 1; block < 128; block++) {
+        if (crc32c(blocks + (block - 1) * 1024, 1024) != block_crc[block]) {
+            fprintf(stderr, "Error: Checksum mismatch in block %d\n", block);
+        }
+    }
+    free(blocks);
 }
 
 void trim_whitespace(char *str) {
@@ -682,12 +1546,25 @@ void trim_whitespace(char *str) {
 
 // Main function
 int main(int argc, char *argv[]) {
-    if (argc != 2) {
-        fprintf(stderr, "Usage: %s <input_file>\n", argv[0]);
+    int option;
+    while ((option = getopt(argc, argv, "dc")) != -1) {
+        if (option == 'd') {
+            dedup_enabled = 1;
+        } else if (option == 'c') {
+            checksums_enabled = 1;
+        } else {
+            fprintf(stderr, "Usage: %s [-d] [-c] <input_file>\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (optind != argc - 1) {
+        fprintf(stderr, "Usage: %s [-d] [-c] <input_file>\n", argv[0]);
         return EXIT_FAILURE;
     }
+    char *input_name = argv[optind];
+    if (dedup_enabled) buffer_hash = block_hash(buffer);
 
-    FILE *input_file = fopen(argv[1], "r");
+    FILE *input_file = fopen(input_name, "r");
     if (!input_file) {
         perror("Error opening input file");
         return EXIT_FAILURE;
@@ -712,18 +1589,18 @@ int main(int argc, char *argv[]) {
                 // printf("Attempting to mount disk: %s\n", disk_name); // Print the disk name
                 fs_mount(disk_name);
             } else {
-                fprintf(stderr, "Command Error: %s, %d\n", argv[1], line_number);
+                fprintf(stderr, "Command Error: %s, %d\n", input_name, line_number);
             }
         } 
         else if (strncmp(command, "C ", 2) == 0) {
-            char name[5]; // No null termination needed
+            char name[128]; // Path, each component at most 5 characters
             int size;
 
             // Parse name and size
-            if (sscanf(command + 2, "%5s %d", name, &size) == 2) {
+            if (sscanf(command + 2, "%127s %d", name, &size) == 2) {
                 // Validate the name length (should be exactly 5 characters or less)
-                if (strlen(name) > 5 || size > 127 || size < 0) {
-                    fprintf(stderr, "Command Error: %s, %d\n", argv[1], line_number);
+                if (!valid_path(name) || size > 127 || size < 0) {
+                    fprintf(stderr, "Command Error: %s, %d\n", input_name, line_number);
                 }
                 else
                 {
@@ -732,42 +1609,35 @@ int main(int argc, char *argv[]) {
             } 
             else 
             {
-                fprintf(stderr, "Command Error: %s, %d\n", argv[1], line_number);
+                fprintf(stderr, "Command Error: %s, %d\n", input_name, line_number);
             }
         }
         else if (strncmp(command, "D ", 2) == 0) {
-            char name[5]; // Temporary buffer for a 5-character name + null terminator
-            int name_length = 0;
-
-            // Parse the name and ensure it doesn't exceed 5 characters
-            if (sscanf(command + 2, "%5s%n", name, &name_length) == 1) {
-                // Check for additional characters beyond 5
-                if (name_length < strlen(command + 2)) {
-                    fprintf(stderr, "Error: File name '%s' exceeds the maximum length of 5 characters.\n", command + 2);
-                } else {
-                    // printf("%s\n", name); // Print the parsed name (up to 5 characters)
-                    fs_delete(name); // Call the delete function with the valid name
-                }
+            char name[128]; // Path, each component at most 5 characters
+
+            // Parse the name and ensure no component exceeds 5 characters
+            if (sscanf(command + 2, "%127s", name) == 1 && valid_path(name)) {
+                fs_delete(name); // Call the delete function with the valid name
             } else {
-                fprintf(stderr, "Command Error: %s, line %d\n", argv[1], line_number);
+                fprintf(stderr, "Command Error: %s, %d\n", input_name, line_number);
             }
         }
         else if (strncmp(command, "R ", 2) == 0) {
-            char name[5];
+            char name[128];
             int block_num;
-            if (sscanf(command + 2, "%5s %d", name, &block_num) == 2) {
+            if (sscanf(command + 2, "%127s %d", name, &block_num) == 2 && valid_path(name)) {
                 fs_read(name, block_num);
             } else {
-                fprintf(stderr, "Command Error: %s, %d\n", argv[1], line_number);
+                fprintf(stderr, "Command Error: %s, %d\n", input_name, line_number);
             }
         } 
         else if (strncmp(command, "W ", 2) == 0) {
-            char name[5];
+            char name[128];
             int block_num;
-            if (sscanf(command + 2, "%5s %d", name, &block_num) == 2) {
+            if (sscanf(command + 2, "%127s %d", name, &block_num) == 2 && valid_path(name)) {
                 fs_write(name, block_num);
             } else {
-                fprintf(stderr, "Command Error: %s, %d\n", argv[1], line_number);
+                fprintf(stderr, "Command Error: %s, %d\n", input_name, line_number);
             }
         } 
         else if (strncmp(command, "B ", 2) == 0) {
@@ -788,28 +1658,37 @@ int main(int argc, char *argv[]) {
             fs_ls();
         } 
         else if (strncmp(command, "E ", 2) == 0) {
-            char name[5];
+            char name[128];
             int new_size;
-            if (sscanf(command + 2, "%5s %d", name, &new_size) == 2) {
+            if (sscanf(command + 2, "%127s %d", name, &new_size) == 2 && valid_path(name)) {
                 fs_resize(name, new_size);
             } else {
-                fprintf(stderr, "Command Error: %s, %d\n", argv[1], line_number);
+                fprintf(stderr, "Command Error: %s, %d\n", input_name, line_number);
             }
         } 
         else if (strncmp(command, "O", 1) == 0) {
             fs_defrag();
         } 
+        else if (strncmp(command, "S", 1) == 0) {
+            fs_snapshot();
+        } 
+        else if (strncmp(command, "U", 1) == 0) {
+            fs_rollback();
+        } 
+        else if (strncmp(command, "V", 1) == 0) {
+            fs_scrub();
+        } 
         else if (strncmp(command, "Y ", 2) == 0) {
-            char dir_name[5];
-            if (sscanf(command + 2, "%5s", dir_name) == 1) {
+            char dir_name[128];
+            if (sscanf(command + 2, "%127s", dir_name) == 1 && valid_path(dir_name)) {
                 // printf("%s meow\n", dir_name);
                 fs_cd(dir_name);
             } else {
-                fprintf(stderr, "Command Error: %s, %d\n", argv[1], line_number);
+                fprintf(stderr, "Command Error: %s, %d\n", input_name, line_number);
             }
         } 
         else {
-            fprintf(stderr, "Command Error: %s, %d\n", argv[1], line_number);
+            fprintf(stderr, "Command Error: %s, %d\n", input_name, line_number);
         }
     }
 